@@ -0,0 +1,129 @@
+/**
+ * Argument Parser
+ *
+ * single pass integer tokenizer for the serial commands :
+ * values are parsed in place (no copy of the input), range checked,
+ * and the first error is kept until the caller checks argEnd()
+ *
+ */
+#ifndef ARG_PARSER_H_
+#define ARG_PARSER_H_
+
+typedef enum {
+  ARG_OK = 0,
+  ARG_MISSING,              // fewer tokens than expected
+  ARG_NOT_A_NUMBER,         // token is not a decimal integer
+  ARG_OUT_OF_RANGE,         // value outside [lo, hi]
+  ARG_TOO_MANY              // trailing tokens after the last expected one
+} ARG_ERRORS;
+
+typedef struct {
+  const char* pos;          // current position in the input
+  uint8_t     index;        // number of the token being parsed (0 based)
+  ARG_ERRORS  error;        // first error, sticky
+} ARGparser;
+
+//////////////////////////////////////
+// argIsDelim
+//////////////////////////////////////
+
+boolean argIsDelim(char c) {
+  return c == ' ' || c == ':' || c == '/' || c == ',' || c == '\t' || c == '\r' || c == '\n';
+}
+
+//////////////////////////////////////
+// argBegin
+//////////////////////////////////////
+
+void argBegin(ARGparser* p, const char* str) {
+  p->pos   = str;
+  p->index = 0;
+  p->error = ARG_OK;
+}
+
+//////////////////////////////////////
+// argHasMore
+//////////////////////////////////////
+
+boolean argHasMore(ARGparser* p) {
+  while (argIsDelim(*p->pos)) p->pos++;
+  return *p->pos != 0;
+}
+
+//////////////////////////////////////
+// argNext : next token as an integer in [lo, hi]
+//           returns lo once an error is set
+//////////////////////////////////////
+
+int argNext(ARGparser* p, int lo, int hi) {
+  if (p->error != ARG_OK) return lo;
+  if (!argHasMore(p)) {
+    p->error = ARG_MISSING;
+    return lo;
+  }
+
+  boolean negative = (*p->pos == '-');
+  if (negative || *p->pos == '+') p->pos++;
+
+  long value = 0;
+  uint8_t digits = 0;
+  while (*p->pos >= '0' && *p->pos <= '9') {
+    if (value <= 32767) value = value * 10 + (*p->pos - '0');
+    p->pos++;
+    digits++;
+  }
+  if (digits == 0 || (*p->pos != 0 && !argIsDelim(*p->pos))) {
+    p->error = ARG_NOT_A_NUMBER;
+    return lo;
+  }
+  if (negative) value = -value;
+  if (value < lo || value > hi) {
+    p->error = ARG_OUT_OF_RANGE;
+    return lo;
+  }
+
+  p->index++;
+  return (int)value;
+}
+
+//////////////////////////////////////
+// argEnd : true when every token parsed and nothing left over
+//////////////////////////////////////
+
+boolean argEnd(ARGparser* p) {
+  if (p->error == ARG_OK && argHasMore(p)) p->error = ARG_TOO_MANY;
+  return p->error == ARG_OK;
+}
+
+//////////////////////////////////////
+// argReport
+//////////////////////////////////////
+
+void argReport(ARGparser* p) {
+  static const char reasons[][20] PROGMEM = { "ok", "missing", "not a number", "out of range", "too many arguments" };
+  txPrintf_P(TXQ_REPORT, PSTR("error : arg %d %S"), p->index + 1, reasons[p->error]);
+}
+
+//////////////////////////////////////
+// argPresent : anything besides delimiters
+//////////////////////////////////////
+
+boolean argPresent(const char* str) {
+  while (argIsDelim(*str)) str++;
+  return *str != 0;
+}
+
+//////////////////////////////////////
+// argValue : single value commands
+//////////////////////////////////////
+
+boolean argValue(const char* str, int lo, int hi, int* value) {
+  ARGparser p;
+  argBegin(&p, str);
+  *value = argNext(&p, lo, hi);
+  if (argEnd(&p)) return true;
+  argReport(&p);
+  return false;
+}
+
+#endif /* ARG_PARSER_H_ */
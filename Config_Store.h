@@ -0,0 +1,147 @@
+/**
+ * Configuration Store
+ *
+ * versioned, CRC protected configuration record in the AT24C32 :
+ * DS3231 alarm / control / status intent (registers 0x07 to 0x0F as one
+ * block) and firmware options. At boot the record is read in one burst,
+ * compared with the RTC and written back in one burst only if they differ
+ *
+ */
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+#include "util/crc16.h"
+
+#define CONFIG_MAGIC        0x5A
+#define CONFIG_VERSION      1
+#define CONFIG_EEPROM_ADDR  0x0000       // page aligned, record must fit one 32 bytes page
+#define CONFIG_WRITE_MS     20           // AT24C32 write cycle is 10ms max
+
+typedef enum {
+  CONFIG_NONE = 0,                       // no valid record
+  CONFIG_MATCHED,                        // RTC already configured
+  CONFIG_APPLIED                         // RTC written
+} CONFIG_RESULTS;
+
+#pragma pack(push, 1)
+
+// DS3231 registers 0x07 to 0x0F
+typedef struct {
+  ALARM1struct         alarm1;
+  ALARM2struct         alarm2;
+  CONTROLstruct        control;
+  CONTROL_STATUSstruct status;
+} RTCCONFIGstruct;
+
+typedef struct {
+  uint16_t tempPeriod;                   // ms, 0 = temperature pipeline off
+  uint8_t  capMode;                      // CAP_MODES
+} OPTIONSstruct;
+
+typedef struct {
+  uint8_t         magic;
+  uint8_t         version;
+  RTCCONFIGstruct rtc;
+  OPTIONSstruct   options;
+  uint16_t        crc;                   // CRC-16 of everything above
+} CONFIGstruct;
+
+#pragma pack(pop)
+
+//////////////////////////////////////
+// eepromRead / eepromWrite
+//////////////////////////////////////
+
+void eepromRead(uint16_t addr, void* buf, uint8_t bytes) {
+  Wire.beginTransmission(AT24C32_I2C_ADDRESS);
+  Wire.write((uint8_t)(addr >> 8));
+  Wire.write((uint8_t)(addr & 0xFF));
+  Wire.endTransmission();
+  Wire.requestFrom(AT24C32_I2C_ADDRESS, (int)bytes);
+  for (uint8_t i = 0; i < bytes; i++) ((uint8_t*)buf)[i] = Wire.read();
+}
+
+boolean eepromWrite(uint16_t addr, const void* buf, uint8_t bytes) {
+  Wire.beginTransmission(AT24C32_I2C_ADDRESS);
+  Wire.write((uint8_t)(addr >> 8));
+  Wire.write((uint8_t)(addr & 0xFF));
+  for (uint8_t i = 0; i < bytes; i++) Wire.write(((const uint8_t*)buf)[i]);
+  if (Wire.endTransmission() != 0) return false;
+
+  // acknowledge polling : the chip NAKs until the write cycle is over
+  unsigned long start = millis();
+  do {
+    Wire.beginTransmission(AT24C32_I2C_ADDRESS);
+    if (Wire.endTransmission() == 0) return true;
+  } while (millis() - start < CONFIG_WRITE_MS);
+  return false;
+}
+
+//////////////////////////////////////
+// configCrc
+//////////////////////////////////////
+
+uint16_t configCrc(const CONFIGstruct* config) {
+  uint16_t crc = 0xFFFF;
+  const uint8_t* p = (const uint8_t*)config;
+  for (uint8_t i = 0; i < sizeof(*config) - sizeof(config->crc); i++) crc = _crc16_update(crc, p[i]);
+  return crc;
+}
+
+//////////////////////////////////////
+// configLoad
+//////////////////////////////////////
+
+boolean configLoad(CONFIGstruct* config) {
+  eepromRead(CONFIG_EEPROM_ADDR, config, sizeof(*config));
+  return config->magic == CONFIG_MAGIC && config->version == CONFIG_VERSION
+      && config->crc == configCrc(config);
+}
+
+//////////////////////////////////////
+// configSave : current RTC registers + options
+//////////////////////////////////////
+
+boolean configSave(const OPTIONSstruct* options) {
+  CONFIGstruct config;
+  config.magic   = CONFIG_MAGIC;
+  config.version = CONFIG_VERSION;
+  readReg(&config.rtc, ALARM1_REG, sizeof(config.rtc));
+  config.rtc.control.CONV = 0;           // transient, never restored
+  unmaskRTCSQW(&config.rtc.control);     // capture / watch sqw are not saved as RTC setup
+  config.options = *options;
+  config.crc = configCrc(&config);
+  return eepromWrite(CONFIG_EEPROM_ADDR, &config, sizeof(config));
+}
+
+//////////////////////////////////////
+// configRestore : boot time, one burst read of each side, one burst write if needed
+//                 holds an SQW claim when the saved capture mode is on
+//////////////////////////////////////
+
+CONFIG_RESULTS configRestore(OPTIONSstruct* options) {
+  CONFIGstruct config;
+  if (!configLoad(&config)) return CONFIG_NONE;
+  *options = config.options;
+
+  RTCCONFIGstruct rtc;
+  readReg(&rtc, ALARM1_REG, sizeof(rtc));
+
+  // only EN32kHz is intent in the status register, the flags are kept as read
+  RTCCONFIGstruct image = config.rtc;
+  image.status = rtc.status;
+  image.status.EN32kHz = config.rtc.status.EN32kHz;
+  image.control.CONV = rtc.control.CONV;
+
+  // a saved capture needs the SQW : claimed here so it goes out in the same
+  // burst, capStart then finds it held and the caller drops this claim
+  if (options->capMode != CAP_OFF) acquireRTCSQW(&image.control);
+
+  if (memcmp(&image, &rtc, sizeof(rtc)) == 0) return CONFIG_MATCHED;
+
+  image.control.CONV = 0;
+  writeReg(&image, ALARM1_REG, sizeof(image));
+  return CONFIG_APPLIED;
+}
+
+#endif /* CONFIG_STORE_H_ */
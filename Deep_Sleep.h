@@ -6,14 +6,17 @@ ISR(WDT_vect){
   //DON'T FORGET THIS!  Needed for the watch dog timer.  
   //This is called after a watch dog timer timeout - 
   //this is the interrupt function called after waking up
-  Serial.println("watchdog wakeup !");
+  Serial.println(F("watchdog wakeup !"));
   wdt_disable(); // disable watchdog
 }// watchdog interrupt
 
 void goToSleep ()
 {
 
-  // disable ADC
+  // drop the awake window (RTC supply, TWI), the next task resumes what it needs
+  powerSuspend();
+  // disable ADC, its setup is restored on wake
+  uint8_t adcsra = ADCSRA;
   ADCSRA = 0;
   // clear various "reset" flags
   MCUSR = 0;
@@ -24,6 +27,12 @@ void goToSleep ()
   //wdt_reset(); // reset the watchdog
   set_sleep_mode (SLEEP_MODE_PWR_DOWN);
   noInterrupts (); // timed sequence follows
+  if (schedEvents) {
+    // an event arrived meanwhile, let the scheduler handle it
+    interrupts ();
+    ADCSRA = adcsra;
+    return;
+  }
   sleep_enable();
   // turn off brown‐out enable in software
   MCUCR = bit (BODS) | bit (BODSE);
@@ -32,4 +41,5 @@ void goToSleep ()
   sleep_cpu ();
   // cancel sleep as a precaution
   sleep_disable();
+  ADCSRA = adcsra;
 }
@@ -0,0 +1,159 @@
+/**
+ * Power Manager
+ *
+ * reference counted power gating of the atmega328 peripherals
+ * through the Power Reduction Register (PRR), plus the RTC module
+ * supply on POWER_PIN
+ *
+ */
+#ifndef POWER_MANAGER_H_
+#define POWER_MANAGER_H_
+
+#include "avr/power.h"
+#include "Wire.h"
+
+#ifndef POWER_PIN_SETTLE_MS
+#define POWER_PIN_SETTLE_MS    2     // RTC module supply rise time before first I2C access
+#endif
+
+typedef enum {
+  PERIPH_ADC = 0,
+  PERIPH_USART0,
+  PERIPH_TIMER0,              // millis() / delay()
+  PERIPH_TIMER1,
+  PERIPH_TIMER2,
+  PERIPH_RTC,                 // ZS-042 supply on POWER_PIN, up before TWI
+  PERIPH_TWI,                 // Wire / DS3231 / AT24C32
+  PERIPH_COUNT
+} PERIPHERALS;
+
+#define NEED(p)   (1 << (p))
+
+// what an awake window needs to talk to the RTC
+#define NEED_RTC  (NEED(PERIPH_TWI) | NEED(PERIPH_RTC))
+
+uint8_t periphRefs[PERIPH_COUNT];
+uint8_t resumeHeld  = 0;      // peripherals held by the current awake window
+uint8_t savedADCSRA = 0;      // ADC setup kept while the ADC is gated
+
+//////////////////////////////////////
+// periphOn
+//////////////////////////////////////
+
+void periphOn(PERIPHERALS p) {
+  switch (p) {
+    case PERIPH_ADC:
+      power_adc_enable();
+      ADCSRA = savedADCSRA;
+      break;
+    case PERIPH_USART0: power_usart0_enable(); break;
+    case PERIPH_TIMER0: power_timer0_enable(); break;
+    case PERIPH_TIMER1: power_timer1_enable(); break;
+    case PERIPH_TIMER2: power_timer2_enable(); break;
+    case PERIPH_TWI:
+      // TWI registers are lost while PRTWI is set, start again from scratch
+      power_twi_enable();
+      Wire.begin();
+      break;
+    case PERIPH_RTC:
+      digitalWrite(POWER_PIN, HIGH);
+      delay(POWER_PIN_SETTLE_MS);
+      break;
+    default: break;
+  }
+}
+
+//////////////////////////////////////
+// periphOff
+//////////////////////////////////////
+
+void periphOff(PERIPHERALS p) {
+  switch (p) {
+    case PERIPH_ADC:
+      // ADC must be disabled before its clock is stopped
+      savedADCSRA = ADCSRA;
+      ADCSRA = 0;
+      power_adc_disable();
+      break;
+    case PERIPH_USART0: power_usart0_disable(); break;
+    case PERIPH_TIMER0: power_timer0_disable(); break;
+    case PERIPH_TIMER1: power_timer1_disable(); break;
+    case PERIPH_TIMER2: power_timer2_disable(); break;
+    case PERIPH_TWI:
+      // no internal pull-ups on SDA/SCL : the module supply may go down next
+      TWCR = 0;
+      digitalWrite(SDA, LOW);
+      digitalWrite(SCL, LOW);
+      power_twi_disable();
+      break;
+    case PERIPH_RTC:    digitalWrite(POWER_PIN, LOW); break;
+    default: break;
+  }
+}
+
+//////////////////////////////////////
+// powerAcquire
+//////////////////////////////////////
+
+void powerAcquire(PERIPHERALS p) {
+  if (periphRefs[p]++ == 0) periphOn(p);
+}
+
+//////////////////////////////////////
+// powerRelease
+//////////////////////////////////////
+
+void powerRelease(PERIPHERALS p) {
+  if (periphRefs[p] == 0) return;
+  if (--periphRefs[p] == 0) periphOff(p);
+}
+
+//////////////////////////////////////
+// powerIsOn
+//////////////////////////////////////
+
+boolean powerIsOn(PERIPHERALS p) {
+  return periphRefs[p] != 0;
+}
+
+//////////////////////////////////////
+// powerResume : acquire only what the next task needs
+//////////////////////////////////////
+
+void powerResume(uint8_t needs) {
+  uint8_t missing = needs & ~resumeHeld;
+  for (uint8_t p = 0; p < PERIPH_COUNT; p++) {
+    if (missing & NEED(p)) powerAcquire((PERIPHERALS)p);
+  }
+  resumeHeld |= missing;
+}
+
+//////////////////////////////////////
+// powerSuspend : drop everything held by the awake window,
+//                reverse order (TWI before the RTC supply)
+//////////////////////////////////////
+
+void powerSuspend() {
+  for (uint8_t p = PERIPH_COUNT; p-- > 0; ) {
+    if (resumeHeld & NEED(p)) powerRelease((PERIPHERALS)p);
+  }
+  resumeHeld = 0;
+}
+
+//////////////////////////////////////
+// powerInit : everything off except what is held for life
+//////////////////////////////////////
+
+void powerInit(uint8_t lifetime) {
+  pinMode(POWER_PIN, OUTPUT);
+  for (uint8_t p = PERIPH_COUNT; p-- > 0; ) {
+    periphRefs[p] = 0;
+    periphOff((PERIPHERALS)p);
+  }
+  resumeHeld = 0;
+  for (uint8_t p = 0; p < PERIPH_COUNT; p++) {
+    if (lifetime & NEED(p)) powerAcquire((PERIPHERALS)p);
+  }
+}
+
+#endif /* POWER_MANAGER_H_ */
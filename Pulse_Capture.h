@@ -0,0 +1,261 @@
+/**
+ * Pulse Capture
+ *
+ * counts and timestamps edges on INTERRUPT_PIN (INT0) at kHz rates.
+ * Each edge gets a 32 bits CPU cycle stamp (timer1 free running at
+ * F_CPU, extended by its overflow interrupt). The RTC 1Hz SQW on
+ * TIME_PIN (INT1) closes one second : count, first and last edge and
+ * the cycles per RTC second go into a small ring, logged in batches of
+ * CAP_BATCH seconds by taskCapture. Raw edge stamps are drained as
+ * soon as their ring is half full : at 115200 the UART takes about 700
+ * "edge" lines per second, faster edges are counted and reported lost.
+ *
+ * Timer1 input capture (ICP1) sits on PB0 = POWER_PIN on this board,
+ * so the stamp is taken in the INT0 handler instead.
+ *
+ */
+#ifndef PULSE_CAPTURE_H_
+#define PULSE_CAPTURE_H_
+
+#ifndef CAP_RING_SIZE
+#define CAP_RING_SIZE      32          // raw edge stamps
+#endif
+#ifndef CAP_SECONDS
+#define CAP_SECONDS        8           // per second summaries
+#endif
+#ifndef CAP_BATCH
+#define CAP_BATCH          4           // seconds per log batch
+#endif
+
+typedef enum {
+  CAP_OFF = 0,
+  CAP_COUNT,                           // per second summaries
+  CAP_RAW                              // summaries + every edge stamp
+} CAP_MODES;
+
+typedef struct {
+  uint32_t anchor;                     // stamp of the SQW edge closing the second
+  uint32_t first;                      // stamp of the first edge in the second
+  uint32_t last;                       // stamp of the last edge in the second
+  uint16_t count;
+} CAPSECONDstruct;
+
+volatile CAP_MODES capMode = CAP_OFF;
+volatile uint16_t  capOverflows = 0;
+
+// current second, INT0 side
+volatile uint16_t  capCount = 0;
+volatile uint32_t  capFirst = 0;
+volatile uint32_t  capLast  = 0;
+
+volatile uint32_t  capRing[CAP_RING_SIZE];
+volatile uint8_t   capHead = 0, capTail = 0;
+volatile uint16_t  capLost = 0;        // edge stamps not stored, ring full
+
+volatile CAPSECONDstruct capSeconds[CAP_SECONDS];
+volatile uint8_t   capSecHead = 0, capSecTail = 0;
+volatile uint16_t  capSecLost = 0;
+
+uint32_t capPrevAnchor = 0;
+boolean  capAnchored = false;          // a full second is known
+uint16_t capSeq = 0;
+
+//////////////////////////////////////
+// cycle stamp, interrupts off
+//////////////////////////////////////
+
+ISR(TIMER1_OVF_vect) {
+  capOverflows++;
+}
+
+uint32_t capStamp() {
+  uint16_t t   = TCNT1;
+  uint16_t ovf = capOverflows;
+  if ((TIFR1 & bit(TOV1)) && t < 0x8000) ovf++;   // overflow not serviced yet
+  return ((uint32_t)ovf << 16) | t;
+}
+
+//////////////////////////////////////
+// ring levels
+//////////////////////////////////////
+
+boolean capEdgesHalf() {
+  return (uint8_t)(capHead + CAP_RING_SIZE - capTail) % CAP_RING_SIZE >= CAP_RING_SIZE / 2;
+}
+
+boolean capBatchReady() {
+  return (uint8_t)(capSecHead + CAP_SECONDS - capSecTail) % CAP_SECONDS >= CAP_BATCH;
+}
+
+//////////////////////////////////////
+// capEdge : INT0 in capture mode
+//////////////////////////////////////
+
+void capEdge() {
+  uint32_t stamp = capStamp();
+  if (capCount == 0) capFirst = stamp;
+  capLast = stamp;
+  if (capCount < 0xFFFF) capCount++;
+
+  if (capMode == CAP_RAW) {
+    uint8_t next = (capHead + 1) % CAP_RING_SIZE;
+    if (next == capTail) {
+      capLost++;
+    } else {
+      capRing[capHead] = stamp;
+      capHead = next;
+    }
+    if (capEdgesHalf()) schedSignal(EV_CAPTURE);   // drain before the ring fills
+  }
+}
+
+//////////////////////////////////////
+// capAnchor : INT1 (1Hz SQW) in capture mode
+//////////////////////////////////////
+
+void capAnchor() {
+  uint8_t next = (capSecHead + 1) % CAP_SECONDS;
+  if (next == capSecTail) {
+    capSecLost++;
+  } else {
+    volatile CAPSECONDstruct* sec = &capSeconds[capSecHead];
+    sec->anchor = capStamp();
+    sec->first  = capFirst;
+    sec->last   = capLast;
+    sec->count  = capCount;
+    capSecHead = next;
+  }
+  capCount = 0;
+  schedSignal(EV_CAPTURE);
+}
+
+//////////////////////////////////////
+// capStart / capStop
+//////////////////////////////////////
+
+void capStart(CAP_MODES mode) {
+  if (capMode == CAP_OFF) {
+    // SQW edges come from the module : keep it supplied between awake windows
+    powerAcquire(PERIPH_RTC);
+    powerAcquire(PERIPH_TIMER1);
+    acquireRTCSQW();
+    noInterrupts();
+    TCCR1A = 0;                        // normal mode, no PWM
+    TCCR1B = bit(CS10);                // F_CPU, no prescaler
+    TCNT1  = 0;
+    TIFR1  = bit(TOV1);
+    TIMSK1 = bit(TOIE1);
+    capOverflows = 0;
+    capCount = 0;
+    capHead = capTail = 0;
+    capSecHead = capSecTail = 0;
+    capLost = capSecLost = 0;
+    interrupts();
+    capAnchored = false;
+    capSeq = 0;
+  }
+  capMode = mode;
+}
+
+void capStop() {
+  if (capMode == CAP_OFF) return;
+  capMode = CAP_OFF;
+  TIMSK1 = 0;
+  TCCR1B = 0;
+  powerRelease(PERIPH_TIMER1);
+  releaseRTCSQW();
+  powerRelease(PERIPH_RTC);
+}
+
+//////////////////////////////////////
+// capRoom : a whole line fits in the report queue, checked before each
+// record so a full queue stops the drain instead of counting drops
+//////////////////////////////////////
+
+boolean capRoom() {
+  return txFree(TXQ_REPORT) > TXQ_LINE_SIZE;
+}
+
+//////////////////////////////////////
+// capLogSecond : false when the line was not queued, retry later
+//////////////////////////////////////
+
+boolean capLogSecond(CAPSECONDstruct* sec) {
+  uint32_t clk = sec->anchor - capPrevAnchor;   // cycles per RTC second
+  if (capAnchored) {
+    // mean frequency from the edge spacing, in mHz
+    uint32_t span = sec->last - sec->first;
+    uint32_t mHz  = (sec->count > 1 && span) ? (uint64_t)(sec->count - 1) * clk * 1000 / span : 0;
+
+    if (!capRoom() ||
+        !txPrintf_P(TXQ_REPORT, PSTR("cap %u n=%u f=%lu.%03lu clk=%lu"),
+                    capSeq, sec->count, (unsigned long)(mHz / 1000), (unsigned long)(mHz % 1000), (unsigned long)clk))
+      return false;
+    capSeq++;
+  }
+  // else capture started inside this second, nothing to log
+  capPrevAnchor = sec->anchor;
+  capAnchored = true;
+  return true;
+}
+
+//////////////////////////////////////
+// capDrain : log what the rings hold, a slot is freed only once its
+// line is queued. Seconds (and losses) only when a batch is ready.
+// False when the report queue is full
+//////////////////////////////////////
+
+boolean capDrain() {
+  boolean batch = capBatchReady();
+  while (batch && capSecTail != capSecHead) {
+    CAPSECONDstruct sec;
+    noInterrupts();
+    sec.anchor = capSeconds[capSecTail].anchor;
+    sec.first  = capSeconds[capSecTail].first;
+    sec.last   = capSeconds[capSecTail].last;
+    sec.count  = capSeconds[capSecTail].count;
+    interrupts();
+    if (!capLogSecond(&sec)) return false;
+    capSecTail = (capSecTail + 1) % CAP_SECONDS;   // single byte, only moved here
+  }
+
+  while (capTail != capHead) {
+    noInterrupts();
+    uint32_t stamp = capRing[capTail];
+    interrupts();
+    if (!capRoom() || !txPrintf_P(TXQ_REPORT, PSTR("edge %08lx"), (unsigned long)stamp)) return false;
+    capTail = (capTail + 1) % CAP_RING_SIZE;
+  }
+
+  if (!batch) return true;
+  noInterrupts();
+  uint16_t lost = capLost, secLost = capSecLost;
+  interrupts();
+  if (lost || secLost) {
+    if (!capRoom() || !txPrintf_P(TXQ_REPORT, PSTR("cap lost %u edges %u seconds"), lost, secLost)) return false;
+    noInterrupts();
+    capLost    -= lost;                // keep what was lost meanwhile
+    capSecLost -= secLost;
+    interrupts();
+  }
+  return true;
+}
+
+//////////////////////////////////////
+// taskCapture : batches of CAP_BATCH seconds, edges from half a ring
+//////////////////////////////////////
+
+char taskCapture(TASKstruct* task) {
+  PT_BEGIN(&task->pt);
+  while (true) {
+    PT_YIELD_UNTIL(&task->pt, capMode != CAP_OFF && (capBatchReady() || capEdgesHalf()));
+
+    // report queue full : wait for the UART to make room, then go on
+    while (capMode != CAP_OFF && !capDrain()) {
+      PT_WAIT_UNTIL(&task->pt, capRoom());
+    }
+  }
+  PT_END(&task->pt);
+}
+
+#endif /* PULSE_CAPTURE_H_ */
@@ -0,0 +1,107 @@
+/**
+ * Register Watch
+ *
+ * live monitoring : burst read of DS3231 registers 0x00 to 0x12, either
+ * every N seconds or on each 1Hz SQW edge, compared with the previous
+ * snapshot. Only the changed registers are sent :
+ *
+ *   W <seq> <reg>=<val> ...     delta record
+ *   F <seq> <reg>=<val> ...     full snapshot (first record, or after a drop)
+ *
+ * reg and val in hex. A record refused by the TX queue invalidates the
+ * snapshot so the next one is a full resync.
+ *
+ */
+#ifndef REG_WATCH_H_
+#define REG_WATCH_H_
+
+#define WATCH_REGS     (TEMP_LSB_REG + 1)     // 0x00 to 0x12
+#define WATCH_ITEM     6                      // " rr=vv"
+
+typedef enum {
+  WATCH_OFF = 0,
+  WATCH_TIMED,                          // task timer
+  WATCH_SQW                             // every RTC second edge
+} WATCH_MODES;
+
+volatile WATCH_MODES watchMode = WATCH_OFF;
+uint8_t  watchPrev[WATCH_REGS];
+boolean  watchValid = false;
+uint16_t watchSeq = 0;
+
+//////////////////////////////////////
+// watchScan
+//////////////////////////////////////
+
+void watchScan() {
+  uint8_t regs[WATCH_REGS];
+  readReg(regs, SECONDS_REG, WATCH_REGS);
+
+  uint8_t changed = 0;
+  for (uint8_t i = 0; i < WATCH_REGS; i++) {
+    if (!watchValid || regs[i] != watchPrev[i]) changed++;
+  }
+  if (changed == 0) return;
+
+  // written straight into the queue, one " rr=vv" item at a time
+  char item[8];
+  sprintf_P(item, PSTR("%c %u"), watchValid ? 'W' : 'F', watchSeq);
+  if (!txReserve(TXQ_REPORT, strlen(item) + changed * WATCH_ITEM + 2)) {
+    watchValid = false;
+    return;
+  }
+  txWrite(TXQ_REPORT, item);
+  for (uint8_t i = 0; i < WATCH_REGS; i++) {
+    if (watchValid && regs[i] == watchPrev[i]) continue;
+    sprintf_P(item, PSTR(" %02x=%02x"), i, regs[i]);
+    txWrite(TXQ_REPORT, item);
+  }
+  txWrite_P(TXQ_REPORT, PSTR("\r\n"));
+  txPump();
+
+  memcpy(watchPrev, regs, WATCH_REGS);
+  watchValid = true;
+  watchSeq++;
+}
+
+//////////////////////////////////////
+// watchStart / watchStop
+//////////////////////////////////////
+
+void watchStop(TASKstruct* task) {
+  if (watchMode == WATCH_SQW) {
+    releaseRTCSQW();
+    powerRelease(PERIPH_RTC);
+  }
+  watchMode = WATCH_OFF;
+  schedEvery(task, 0);
+}
+
+void watchStart(TASKstruct* task, uint8_t seconds) {
+  watchStop(task);
+  watchValid = false;
+  if (seconds) {
+    watchMode = WATCH_TIMED;
+    schedEvery(task, seconds * 1000U);
+  } else {
+    // SQW edges have to reach TIME_PIN through PWR_DOWN : keep the module supplied
+    powerAcquire(PERIPH_RTC);
+    acquireRTCSQW();
+    watchMode = WATCH_SQW;
+  }
+}
+
+//////////////////////////////////////
+// taskWatch
+//////////////////////////////////////
+
+char taskWatch(TASKstruct* task) {
+  PT_BEGIN(&task->pt);
+  if (watchMode != WATCH_OFF) {
+    powerResume(NEED_RTC);
+    watchScan();
+  }
+  PT_END(&task->pt);
+}
+
+#endif /* REG_WATCH_H_ */
@@ -0,0 +1,226 @@
+/**
+ * Cooperative Scheduler
+ *
+ * task table of stackless protothreads, woken by event bits set from
+ * the ISRs, by their own timer, or polled while blocked in
+ * PT_WAIT_UNTIL. When nothing is runnable the CPU sleeps : IDLE while
+ * anything is pending (timer0 tick, UART), PWR_DOWN once the serial
+ * line has been quiet for SCHED_SERIAL_IDLE_MS and no timer is armed.
+ * The awake window (powerResume) is dropped before either sleep unless
+ * a task is still polling
+ *
+ * wake from PWR_DOWN by serial : the oscillator start-up (16K CK) eats
+ * about 1ms of RX, ~11 bytes at 115200. The host sends a wake byte
+ * ('\n') and waits for the "wake" prompt before its command; whatever
+ * arrives before the prompt is discarded, and reported when it looked
+ * like a command.
+ *
+ */
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include "avr/sleep.h"
+#include "Serial_Queue.h"
+#include "Power_Manager.h"
+
+void goToSleep();              // Deep_Sleep.h
+
+#ifndef SCHED_SERIAL_IDLE_MS
+#define SCHED_SERIAL_IDLE_MS   30000UL   // serial quiet time before PWR_DOWN
+#endif
+#ifndef SCHED_WAKE_GUARD_MS
+#define SCHED_WAKE_GUARD_MS    3         // RX quiet time after a serial wake before the prompt
+#endif
+
+///////////////////
+// protothreads
+//////////////////
+
+typedef struct {
+  uint16_t lc;                 // local continuation (source line)
+} PTstruct;
+
+enum PT_STATES {
+  PT_WAITING = 0,              // blocked in PT_WAIT_UNTIL, poll again
+  PT_YIELDED,                  // run again on event or timer
+  PT_ENDED
+};
+
+// the case labels below are meant to be fallen into (-Wimplicit-fallthrough)
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define PT_FALLTHROUGH          __attribute__((fallthrough))
+#else
+#define PT_FALLTHROUGH
+#endif
+
+#define PT_BEGIN(pt)            switch ((pt)->lc) { case 0:
+#define PT_END(pt)              } (pt)->lc = 0; return PT_ENDED
+#define PT_WAIT_UNTIL(pt, c)    do { (pt)->lc = __LINE__; PT_FALLTHROUGH; case __LINE__: if (!(c)) return PT_WAITING; } while (0)
+#define PT_YIELD(pt)            do { (pt)->lc = __LINE__; return PT_YIELDED; case __LINE__: ; } while (0)
+#define PT_YIELD_UNTIL(pt, c)   do { (pt)->lc = __LINE__; PT_FALLTHROUGH; case __LINE__: if (!(c)) return PT_YIELDED; } while (0)
+
+///////////////////
+// events
+//////////////////
+
+enum SCHED_EVENTS {
+  EV_SERIAL   = 1,             // bytes in the Serial RX buffer
+  EV_DIGITAL  = 2,             // edge on INTERRUPT_PIN
+  EV_ALARM    = 4,             // edge on TIME_PIN (RTC INT/SQW)
+  EV_CAPTURE  = 8,             // pulse capture : one RTC second closed
+  EV_WATCH    = 16             // register watch : SQW edge
+};
+
+volatile uint8_t schedEvents = 0;
+
+// ISR side : single byte read-modify-write, interrupts are already off
+#define schedSignal(ev)   (schedEvents |= (ev))
+
+///////////////////
+// tasks
+//////////////////
+
+struct TASKstruct;
+typedef char (*TASKfunc)(struct TASKstruct* task);
+
+typedef struct TASKstruct {
+  TASKfunc  run;
+  uint8_t   events;            // event bits this task waits on
+  uint16_t  period;            // ms between timed runs, 0 = one shot
+  uint8_t   pending;           // events received, not yet run
+  boolean   armed;             // timer running
+  boolean   poll;              // blocked in PT_WAIT_UNTIL
+  uint32_t  due;               // millis() of the next timed run
+  PTstruct  pt;
+} TASKstruct;
+
+#define TASK(fn, events, period)   { fn, events, period, 0, (period) != 0, false, 0, { 0 } }
+
+unsigned long schedLastRx = 0; // millis() of the last serial activity
+volatile boolean schedRxWoke = false;   // PWR_DOWN left by RX, line start lost
+
+//////////////////////////////////////
+// schedDelay : run the task again in ms
+//////////////////////////////////////
+
+void schedDelay(TASKstruct* task, uint16_t ms) {
+  task->due   = millis() + ms;
+  task->armed = true;
+}
+
+//////////////////////////////////////
+// schedEvery : periodic run, 0 = stop
+//////////////////////////////////////
+
+void schedEvery(TASKstruct* task, uint16_t ms) {
+  task->period = ms;
+  if (ms) schedDelay(task, ms);
+  else task->armed = false;
+}
+
+//////////////////////////////////////
+// schedTimerDue
+//////////////////////////////////////
+
+boolean schedTimerDue(TASKstruct* task) {
+  return task->armed && (long)(millis() - task->due) >= 0;
+}
+
+//////////////////////////////////////
+// RX wake from PWR_DOWN : pin change on RXD (PD0 / PCINT16)
+// the bytes received while the oscillator starts are lost
+//////////////////////////////////////
+
+ISR(PCINT2_vect) {
+  PCICR &= ~bit(PCIE2);
+  schedRxWoke = true;
+  schedSignal(EV_SERIAL);
+}
+
+void schedRxWakeEnable() {
+  PCMSK2 |= bit(PCINT16);
+  PCIFR   = bit(PCIF2);
+  PCICR  |= bit(PCIE2);
+}
+
+//////////////////////////////////////
+// schedIdle : sleep until the next interrupt
+//////////////////////////////////////
+
+void schedIdle(TASKstruct* tasks, uint8_t count) {
+  // PWR_DOWN stops every timer clock : not while one is in use
+  boolean deep = txIdle() && !Serial.available()
+              && millis() - schedLastRx >= SCHED_SERIAL_IDLE_MS
+              && !powerIsOn(PERIPH_TIMER1) && !powerIsOn(PERIPH_TIMER2);
+  boolean polling = false;
+  for (uint8_t i = 0; i < count; i++) {
+    if (tasks[i].poll) polling = true;
+    if (tasks[i].armed || tasks[i].poll || tasks[i].pending) deep = false;
+  }
+
+  // no task half way through a transaction : drop the awake window,
+  // the next one resumes only what it needs
+  if (!polling) powerSuspend();
+
+  if (deep) {
+    Serial.flush();
+    schedRxWakeEnable();
+    goToSleep();               // aborts if an event is already pending
+    PCICR &= ~bit(PCIE2);
+    schedLastRx = millis();    // stay awake for the next command
+    return;
+  }
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  noInterrupts();
+  if (schedEvents) {
+    interrupts();
+    return;
+  }
+  sleep_enable();
+  interrupts();                // guarantees next instruction executed
+  sleep_cpu();
+  sleep_disable();
+}
+
+//////////////////////////////////////
+// schedRun : one pass over the task table, sleeps when nothing ran
+//////////////////////////////////////
+
+void schedRun(TASKstruct* tasks, uint8_t count) {
+  txPump();
+
+  if (Serial.available()) {
+    schedLastRx = millis();
+    noInterrupts();
+    schedSignal(EV_SERIAL);
+    interrupts();
+  }
+
+  noInterrupts();
+  uint8_t events = schedEvents;
+  schedEvents = 0;
+  interrupts();
+
+  boolean ran = false;
+  for (uint8_t i = 0; i < count; i++) {
+    TASKstruct* task = &tasks[i];
+    task->pending |= events & task->events;
+
+    boolean due = schedTimerDue(task);
+    if (!task->pending && !due && !task->poll) continue;
+
+    if (due) {
+      if (!task->period) task->armed = false;
+      else if ((long)(millis() - (task->due += task->period)) >= 0) schedDelay(task, task->period);  // fell behind
+    }
+    // a task that only polls does not keep the CPU out of IDLE
+    if (task->pending || due) ran = true;
+    task->pending = 0;
+    task->poll = (task->run(task) == PT_WAITING);
+  }
+
+  if (!ran) schedIdle(tasks, count);
+}
+
+#endif /* SCHEDULER_H_ */
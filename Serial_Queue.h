@@ -0,0 +1,179 @@
+/**
+ * Serial TX Queue
+ *
+ * prioritized software queues in front of the 64 bytes HardwareSerial
+ * TX ring : writers never busy-wait, they get false back when a queue
+ * is full (backpressure). txPump() feeds the UART from loop(), events
+ * first, one whole line at a time so levels never interleave mid-line.
+ * Every write is one complete line, "\r\n" is added by the queue.
+ * Lines that do not fit are dropped and coalesced into a single
+ * "[N dropped]" notice once that queue has drained. Constant text and
+ * formats stay in flash : txPrintln_P / txPrintf_P take PSTR() strings.
+ *
+ */
+#ifndef SERIAL_QUEUE_H_
+#define SERIAL_QUEUE_H_
+
+#include <stdarg.h>
+#include <avr/pgmspace.h>
+
+#ifndef TXQ_EVENT_SIZE
+#define TXQ_EVENT_SIZE     64      // interrupt / alarm notifications, one pair of lines at least
+#endif
+#ifndef TXQ_REPORT_SIZE
+#define TXQ_REPORT_SIZE    160     // verbose command replies
+#endif
+#define TXQ_LINE_SIZE      48      // longest txPrintf_P line (stack), longer ones end in '~'
+
+typedef enum {
+  TXQ_EVENT = 0,               // highest priority
+  TXQ_REPORT,
+  TXQ_LEVELS
+} TXQ_PRIORITY;
+
+typedef struct {
+  char*    buf;
+  uint16_t size;
+  uint16_t head;               // next write
+  uint16_t tail;               // next read
+  uint16_t dropped;            // lines refused since the last notice
+} TXQueue;
+
+char txEventBuf[TXQ_EVENT_SIZE];
+char txReportBuf[TXQ_REPORT_SIZE];
+
+TXQueue txQueues[TXQ_LEVELS] = {
+  { txEventBuf,  TXQ_EVENT_SIZE,  0, 0, 0 },
+  { txReportBuf, TXQ_REPORT_SIZE, 0, 0, 0 }
+};
+
+int8_t txCurrent = -1;         // level being sent, -1 = at a line boundary
+
+//////////////////////////////////////
+// txUsed / txFree
+//////////////////////////////////////
+
+uint16_t txUsed(TXQ_PRIORITY prio) {
+  TXQueue* q = &txQueues[prio];
+  return (q->head + q->size - q->tail) % q->size;
+}
+
+uint16_t txFree(TXQ_PRIORITY prio) {
+  return txQueues[prio].size - 1 - txUsed(prio);
+}
+
+boolean txIdle() {
+  return txUsed(TXQ_EVENT) == 0 && txUsed(TXQ_REPORT) == 0;
+}
+
+//////////////////////////////////////
+// txReserve : all or nothing, the caller then writes exactly len bytes
+//////////////////////////////////////
+
+boolean txReserve(TXQ_PRIORITY prio, uint16_t len) {
+  if (len <= txFree(prio)) return true;
+  txQueues[prio].dropped++;
+  return false;
+}
+
+void txWrite(TXQ_PRIORITY prio, const char* str) {
+  TXQueue* q = &txQueues[prio];
+  while (*str) {
+    q->buf[q->head] = *str++;
+    q->head = (q->head + 1) % q->size;
+  }
+}
+
+void txWrite_P(TXQ_PRIORITY prio, PGM_P str) {
+  TXQueue* q = &txQueues[prio];
+  char c;
+  while ((c = pgm_read_byte(str++))) {
+    q->buf[q->head] = c;
+    q->head = (q->head + 1) % q->size;
+  }
+}
+
+//////////////////////////////////////
+// txPump : move what the UART can take now, never blocks
+//////////////////////////////////////
+
+void txPump() {
+  int room = Serial.availableForWrite();
+  while (room > 0) {
+    if (txCurrent < 0) {
+      // line boundary : notices for what was dropped, then the highest level with data
+      for (uint8_t level = 0; level < TXQ_LEVELS; level++) {
+        TXQueue* q = &txQueues[level];
+        if (q->dropped && txUsed((TXQ_PRIORITY)level) == 0) {
+          char notice[20];                        // "[65535 dropped]\r\n"
+          snprintf_P(notice, sizeof(notice), PSTR("[%u dropped]\r\n"), q->dropped);
+          q->dropped = 0;
+          txWrite((TXQ_PRIORITY)level, notice);   // the queue is empty
+        }
+      }
+      for (uint8_t level = 0; level < TXQ_LEVELS; level++) {
+        if (txUsed((TXQ_PRIORITY)level)) {
+          txCurrent = level;
+          break;
+        }
+      }
+      if (txCurrent < 0) return;
+    }
+
+    TXQueue* q = &txQueues[txCurrent];
+    if (q->head == q->tail) {
+      txCurrent = -1;
+      continue;
+    }
+    char c = q->buf[q->tail];
+    q->tail = (q->tail + 1) % q->size;
+    Serial.write(c);
+    room--;
+    if (c == '\n') txCurrent = -1;
+  }
+}
+
+//////////////////////////////////////
+// txPrintln / txPrintln_P / txPrintf_P : one whole line each
+//////////////////////////////////////
+
+boolean txPrintln(TXQ_PRIORITY prio, const char* str) {
+  boolean ok = txReserve(prio, strlen(str) + 2);
+  if (ok) {
+    txWrite(prio, str);
+    txWrite_P(prio, PSTR("\r\n"));
+  }
+  txPump();
+  return ok;
+}
+
+boolean txPrintln_P(TXQ_PRIORITY prio, PGM_P str) {
+  boolean ok = txReserve(prio, strlen_P(str) + 2);
+  if (ok) {
+    txWrite_P(prio, str);
+    txWrite_P(prio, PSTR("\r\n"));
+  }
+  txPump();
+  return ok;
+}
+
+boolean txPrintf_P(TXQ_PRIORITY prio, PGM_P fmt, ...) {
+  char line[TXQ_LINE_SIZE];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf_P(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (n >= (int)sizeof(line)) line[sizeof(line) - 2] = '~';   // truncated
+  return txPrintln(prio, line);
+}
+
+//////////////////////////////////////
+// txFlush : blocking, before sleep only
+//////////////////////////////////////
+
+void txFlush() {
+  while (!txIdle()) txPump();
+  Serial.flush();
+}
+
+#endif /* SERIAL_QUEUE_H_ */
@@ -0,0 +1,120 @@
+/**
+ * Time Zone
+ *
+ * the RTC runs in UTC, local time is rendered on the device from a
+ * PROGMEM table of offset transitions. The table is computed by the
+ * compiler (constexpr) from the EU rule : summer time from the last
+ * Sunday of March to the last Sunday of October, 01:00 UTC both ways.
+ * The offset found by binary search is cached until the next transition
+ *
+ */
+#ifndef TZ_TABLE_H_
+#define TZ_TABLE_H_
+
+#include "avr/pgmspace.h"
+
+#ifndef TZ_STD_OFFSET
+#define TZ_STD_OFFSET      60          // minutes east of UTC, winter
+#endif
+#ifndef TZ_DST_OFFSET
+#define TZ_DST_OFFSET      120         // minutes east of UTC, summer
+#endif
+#ifndef TZ_STD_NAME
+#define TZ_STD_NAME        "CET"
+#endif
+#ifndef TZ_DST_NAME
+#define TZ_DST_NAME        "CEST"
+#endif
+
+#pragma pack(push, 1)
+typedef struct {
+  uint32_t utc;                        // transition instant, unix time
+  int16_t  offset;                     // minutes east of UTC from then on
+} TZTRANSITIONstruct;
+#pragma pack(pop)
+
+//////////////////////////////////////
+// compile time calendar (days since 1970-01-01, months > 2 only)
+//////////////////////////////////////
+
+constexpr uint32_t tzDays(uint32_t y, uint32_t m, uint32_t d) {
+  return (y / 400) * 146097 + (y % 400) * 365 + (y % 400) / 4 - (y % 400) / 100
+       + (153 * (m - 3) + 2) / 5 + d - 1 - 719468;
+}
+
+constexpr uint32_t tzLastSunday(uint32_t y, uint32_t m) {
+  return tzDays(y, m, 31) - (tzDays(y, m, 31) + 4) % 7;    // 1970-01-01 was a Thursday
+}
+
+constexpr uint32_t tzTransition(uint32_t y, uint32_t m) {
+  return tzLastSunday(y, m) * 86400UL + 3600UL;
+}
+
+#define TZ_EU_YEAR(y)  { tzTransition(y, 3),  TZ_DST_OFFSET }, \
+                       { tzTransition(y, 10), TZ_STD_OFFSET }
+
+const TZTRANSITIONstruct tzTable[] PROGMEM = {
+  { 0, TZ_STD_OFFSET },
+  TZ_EU_YEAR(2020), TZ_EU_YEAR(2021), TZ_EU_YEAR(2022), TZ_EU_YEAR(2023),
+  TZ_EU_YEAR(2024), TZ_EU_YEAR(2025), TZ_EU_YEAR(2026), TZ_EU_YEAR(2027),
+  TZ_EU_YEAR(2028), TZ_EU_YEAR(2029), TZ_EU_YEAR(2030), TZ_EU_YEAR(2031),
+  TZ_EU_YEAR(2032), TZ_EU_YEAR(2033), TZ_EU_YEAR(2034), TZ_EU_YEAR(2035),
+  TZ_EU_YEAR(2036), TZ_EU_YEAR(2037)
+};
+#define TZ_TABLE_SIZE (sizeof(tzTable) / sizeof(tzTable[0]))
+
+static_assert(tzTransition(2020, 3) == 1585443600UL, "EU rule : 2020-03-29 01:00 UTC");
+static_assert(tzTransition(2020, 10) == 1603587600UL, "EU rule : 2020-10-25 01:00 UTC");
+
+struct {
+  uint32_t from;                       // cached offset valid in [from, until)
+  uint32_t until;
+  int16_t  offset;
+} tzCache = { 1, 0, 0 };               // empty
+
+//////////////////////////////////////
+// tzOffset : minutes east of UTC at t
+//////////////////////////////////////
+
+int16_t tzOffset(time_t t) {
+  if (t >= tzCache.from && t < tzCache.until) return tzCache.offset;
+
+  // last transition <= t
+  uint8_t lo = 0, hi = TZ_TABLE_SIZE - 1;
+  while (lo < hi) {
+    uint8_t mid = (lo + hi + 1) / 2;
+    if (pgm_read_dword(&tzTable[mid].utc) <= t) lo = mid;
+    else hi = mid - 1;
+  }
+
+  tzCache.from   = pgm_read_dword(&tzTable[lo].utc);
+  tzCache.until  = lo < TZ_TABLE_SIZE - 1 ? pgm_read_dword(&tzTable[lo + 1].utc) : 0xFFFFFFFFUL;
+  tzCache.offset = (int16_t)pgm_read_word(&tzTable[lo].offset);
+  return tzCache.offset;
+}
+
+//////////////////////////////////////
+// tzLocal / tzName
+//////////////////////////////////////
+
+time_t tzLocal(time_t utc) {
+  return utc + (long)tzOffset(utc) * 60;
+}
+
+const char *tzName(time_t utc) {
+  return tzOffset(utc) == TZ_STD_OFFSET ? TZ_STD_NAME : TZ_DST_NAME;
+}
+
+//////////////////////////////////////
+// timeToLocalStr
+//////////////////////////////////////
+
+char *timeToLocalStr(time_t utc){
+  tmElements_t tm;
+  breakTime(tzLocal(utc), tm);
+  static char timeStr[32];
+  sprintf(timeStr, "%02d:%02d:%02d %02d/%02d/%4d %d %s", tm.Hour, tm.Minute, tm.Second, tm.Day, tm.Month, tm.Year + 1970, tm.Wday, tzName(utc));
+  return timeStr;
+}
+
+#endif /* TZ_TABLE_H_ */
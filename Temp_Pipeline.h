@@ -0,0 +1,146 @@
+/**
+ * Temperature Pipeline
+ *
+ * non-blocking DS3231 conversion : wait BSY clear, set CONV, wait CONV
+ * clear, burst read TEMP_MSB/LSB, then feed a ring of samples kept in
+ * quarters of °C for the rolling mean, min, max and rate of change
+ *
+ */
+#ifndef TEMP_PIPELINE_H_
+#define TEMP_PIPELINE_H_
+
+#ifndef TEMP_RING_SIZE
+#define TEMP_RING_SIZE     16          // samples kept for the statistics
+#endif
+#ifndef TEMP_PERIOD_MS
+#define TEMP_PERIOD_MS     0           // conversion rate, 0 = off (blocks PWR_DOWN while on)
+#endif
+#define TEMP_POLL_MS       10          // BSY / CONV poll interval (conversion ~ 200ms)
+
+int16_t  tempRing[TEMP_RING_SIZE];     // quarters of °C
+uint32_t tempStamp[TEMP_RING_SIZE];    // millis() of each sample
+uint8_t  tempHead  = 0;                // next slot
+uint8_t  tempCount = 0;
+int32_t  tempSum   = 0;
+uint32_t tempPollAt = 0;
+
+typedef struct {
+  int16_t last;                        // quarters of °C
+  int16_t mean;
+  int16_t min;
+  int16_t max;
+  int16_t rate;                        // hundredths of °C per minute
+  uint8_t count;
+} TEMPSTATSstruct;
+
+//////////////////////////////////////
+// tempBusy : BSY or CONV still set, one 2 bytes burst
+//////////////////////////////////////
+
+boolean tempBusy() {
+  struct {
+    CONTROLstruct        control;
+    CONTROL_STATUSstruct status;
+  } regs;
+  readReg(&regs, CONTROL_REG, sizeof(regs));
+  return regs.control.CONV || regs.status.BSY;
+}
+
+//////////////////////////////////////
+// tempPoll : true once the RTC is idle, reads it every TEMP_POLL_MS only
+//////////////////////////////////////
+
+boolean tempPoll() {
+  if (millis() - tempPollAt < TEMP_POLL_MS) return false;
+  tempPollAt = millis();
+  return !tempBusy();
+}
+
+//////////////////////////////////////
+// tempPush
+//////////////////////////////////////
+
+void tempPush(int16_t quarters) {
+  if (tempCount == TEMP_RING_SIZE) tempSum -= tempRing[tempHead];
+  else tempCount++;
+  tempRing[tempHead]  = quarters;
+  tempStamp[tempHead] = millis();
+  tempSum += quarters;
+  tempHead = (tempHead + 1) % TEMP_RING_SIZE;
+}
+
+//////////////////////////////////////
+// tempStats
+//////////////////////////////////////
+
+boolean tempStats(TEMPSTATSstruct* stats) {
+  stats->count = tempCount;
+  if (tempCount == 0) return false;
+
+  uint8_t newest = (tempHead + TEMP_RING_SIZE - 1) % TEMP_RING_SIZE;
+  uint8_t oldest = (tempHead + TEMP_RING_SIZE - tempCount) % TEMP_RING_SIZE;
+
+  stats->last = tempRing[newest];
+  stats->mean = tempSum / tempCount;
+  stats->min  = stats->max = tempRing[oldest];
+  for (uint8_t i = 0; i < tempCount; i++) {
+    int16_t v = tempRing[(oldest + i) % TEMP_RING_SIZE];
+    if (v < stats->min) stats->min = v;
+    if (v > stats->max) stats->max = v;
+  }
+
+  uint32_t dt = tempStamp[newest] - tempStamp[oldest];
+  stats->rate = dt ? (int32_t)(tempRing[newest] - tempRing[oldest]) * 25 * 60000L / (int32_t)dt : 0;
+  return true;
+}
+
+//////////////////////////////////////
+// tempToStr : quarters of °C to "-12.75"
+//////////////////////////////////////
+
+char *tempToStr(int16_t quarters, char* str) {
+  uint16_t q = quarters < 0 ? -quarters : quarters;
+  sprintf(str, "%s%u.%02u", quarters < 0 ? "-" : "", q / 4, (q % 4) * 25);
+  return str;
+}
+
+//////////////////////////////////////
+// tempReport : temp command
+//////////////////////////////////////
+
+void tempReport() {
+  TEMPSTATSstruct stats;
+  if (!tempStats(&stats)) {
+    txPrintln_P(TXQ_REPORT, PSTR("no sample yet"));
+    return;
+  }
+  char last[8], mean[8], min[8], max[8];
+  uint16_t rate = stats.rate < 0 ? -stats.rate : stats.rate;
+  txPrintf_P(TXQ_REPORT, PSTR("last %s mean %s min %s max %s"),
+           tempToStr(stats.last, last), tempToStr(stats.mean, mean),
+           tempToStr(stats.min, min), tempToStr(stats.max, max));
+  txPrintf_P(TXQ_REPORT, PSTR("rate %s%u.%02u/min n=%d"),
+           stats.rate < 0 ? "-" : "", rate / 100, rate % 100, stats.count);
+}
+
+//////////////////////////////////////
+// taskTemp : one conversion per timed run
+//////////////////////////////////////
+
+char taskTemp(TASKstruct* task) {
+  PT_BEGIN(&task->pt);
+  powerResume(NEED_RTC);
+
+  // an automatic TCXO conversion may be running
+  PT_WAIT_UNTIL(&task->pt, tempPoll());
+  setRTCCONV(1);
+  tempPollAt = millis();
+  PT_WAIT_UNTIL(&task->pt, tempPoll());
+
+  TEMPstruct temp;
+  readReg(&temp, TEMP_REG, sizeof(temp));
+  tempPush(temp.MSB_bits.data * 4 + temp.LSB_bits.dot25);
+  PT_END(&task->pt);
+}
+
+#endif /* TEMP_PIPELINE_H_ */
@@ -11,6 +11,9 @@
 #define AT24C32_I2C_ADDRESS    0x57  // On-board 32k byte EEPROM; 128 pages of 32 bytes each
 
 #include "TimeLib.h"
+#include "TZ_Table.h"
+#include "Serial_Queue.h"
+#include "Arg_Parser.h"
 /*
   low level functions to convert to and from system time 
   void breakTime(time_t time, tmElements_t &tm);  // break time_t into elements
@@ -215,35 +218,56 @@ typedef struct  {
 char *timeToStr(time_t t){
   tmElements_t tm;
   breakTime(t, tm);
-  static char timeStr[64];
+  static char timeStr[24];             // "hh:mm:ss dd/mm/yyyy d"
   sprintf(timeStr, "%02d:%02d:%02d %02d/%02d/%4d %d", tm.Hour, tm.Minute, tm.Second, tm.Day, tm.Month, tm.Year + 1970, tm.Wday);
   return timeStr;
 }
 
 //////////////////////////////////////
-// strToTime 
+// daysInMonth : month 1-12, year from 1970 (tmElements_t)
 //////////////////////////////////////
 
-time_t strToTime(char* str){
-  tmElements_t tm;
+uint8_t daysInMonth(uint8_t month, uint8_t year){
+  static const uint8_t days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  uint16_t y = 1970 + year;
+  boolean leap = (y % 4 == 0) && ((y % 100 != 0) || (y % 400 == 0));
+  return days[month - 1] + (month == 2 && leap ? 1 : 0);
+}
+
+//////////////////////////////////////
+// strToTm : "hh:mm:ss dd/mm/yy [wday]"
+//////////////////////////////////////
 
-  char delim[] = ": /";
-  char values[6][5];
-  char* token = strtok(str, delim);
-  int i = 0;
-  while (token != NULL) {
-    strncpy(values[i], token, sizeof(values[i]));
-    token = strtok(NULL, delim);
-    i++;
+boolean strToTm(const char* str, tmElements_t &tm){
+  ARGparser args;
+  argBegin(&args, str);
+
+  tm.Hour   = argNext(&args, 0, 23);
+  tm.Minute = argNext(&args, 0, 59);
+  tm.Second = argNext(&args, 0, 59);
+  tm.Day    = argNext(&args, 1, 31);
+  tm.Month  = argNext(&args, 1, 12);
+  tm.Year   = argNext(&args, 0, 99) + 30;
+  if (args.error == ARG_OK && tm.Day > daysInMonth(tm.Month, tm.Year)) {
+    args.index = 3;                   // report the day, not the year
+    args.error = ARG_OUT_OF_RANGE;
+  }
+  if (args.error == ARG_OK && argHasMore(&args)) {
+    tm.Wday = argNext(&args, 1, 7);   // optional, recomputed by makeTime
   }
 
-  tm.Hour   = atoi(values[0]);
-  tm.Minute = atoi(values[1]);
-  tm.Second = atoi(values[2]);
-  tm.Day    = atoi(values[3]);
-  tm.Month  = atoi(values[4]);
-  tm.Year   = atoi(values[5]) + 30;
-  
+  if (argEnd(&args)) return true;
+  argReport(&args);
+  return false;
+}
+
+//////////////////////////////////////
+// strToTime 
+//////////////////////////////////////
+
+time_t strToTime(const char* str){
+  tmElements_t tm;
+  if (!strToTm(str, tm)) return 0;
   return makeTime(tm);
 }
 
@@ -329,20 +353,9 @@ void getRTCStatus() {
   //SerialSerial.println("--> RTCStatus : display");
   CONTROL_STATUSstruct status;
   readReg(&status, CONTROL_STATUS_REG);
-  Serial.print("A1F     ");
-  Serial.print("A2F     ");
-  Serial.print("BSY     ");
-  Serial.print("EN32kHz ");
-  Serial.print("msb     ");
-  Serial.print("OSF     ");
-  Serial.println("");
-  Serial.print("  "      + String(status.A1F)) ;
-  Serial.print("       " + String(status.A2F));
-  Serial.print("       " + String(status.BSY) );
-  Serial.print("       " + String(status.EN32kHz)  );
-  Serial.print("       " + String(status.msb)  );
-  Serial.print("       " + String(status.OSF));
-  Serial.println("");
+  txPrintln_P(TXQ_REPORT, PSTR("A1F     A2F     BSY     EN32kHz msb     OSF     "));
+  txPrintf_P(TXQ_REPORT, PSTR("  %d       %d       %d       %d       %d       %d"),
+           status.A1F, status.A2F, status.BSY, status.EN32kHz, status.msb, status.OSF);
   
 }
 
@@ -355,53 +368,62 @@ void getRTCControl() {
   CONTROLstruct control;
   readReg(&control, CONTROL_REG, sizeof(control));
   
-  Serial.print("EOSC   ");
-  Serial.print("BBSQW ");
-  Serial.print("CONV  ");
-  Serial.print("RS    ");
-  Serial.print("INTCN ");
-  Serial.print("A2IE  ");
-  Serial.print("A1IE  ");
-  Serial.println("");
-  Serial.print("  "    + String(control.EOSC)) ;
-  Serial.print("     " + String(control.BBSQW));
-  Serial.print("     " + String(control.CONV) );
-  Serial.print("     " + String(control.RS));
-  Serial.print("     " + String(control.INTCN));
-  Serial.print("     " + String(control.A2IE) );
-  Serial.print("     " + String(control.A1IE) );
-  Serial.println("");
+  txPrintln_P(TXQ_REPORT, PSTR("EOSC   BBSQW CONV  RS    INTCN A2IE  A1IE  "));
+  txPrintf_P(TXQ_REPORT, PSTR("  %d     %d     %d     %d     %d     %d     %d"),
+           control.EOSC, control.BBSQW, control.CONV, control.RS, control.INTCN, control.A2IE, control.A1IE);
   
 }
 
+//////////////////////////////////////
+// RTCSQW state : while the SQW is held, RS and INTCN written by the user
+// go to the saved copy, the register keeps the 1Hz square wave
+//////////////////////////////////////
+
+uint8_t sqwUsers = 0;
+uint8_t sqwSavedRS = 0;
+uint8_t sqwSavedINTCN = 1;
+
+void maskRTCSQW(CONTROLstruct* control) {
+  if (sqwUsers == 0) return;
+  sqwSavedRS     = control->RS;
+  sqwSavedINTCN  = control->INTCN;
+  control->RS    = freq_1Hz;
+  control->INTCN = 0;
+}
+
+// control image without the SQW override, as the user set it
+void unmaskRTCSQW(CONTROLstruct* control) {
+  if (sqwUsers == 0) return;
+  control->RS    = sqwSavedRS;
+  control->INTCN = sqwSavedINTCN;
+}
+
 //////////////////////////////////////
 // RTCControl set
 //////////////////////////////////////
 
-void setRTCControl(char* buf) {
+boolean setRTCControl(const char* buf) {
   //Serial.println("--> RTCControl : set " + String(buf));
   CONTROLstruct control;
   readReg(&control, CONTROL_REG);
 
-  char delim[] = ": /,";
-  char valueParsed[7][10];
-  char* token = strtok(buf, delim);
-  int i = 0;
-  while (token != NULL) {
-    strncpy(valueParsed[i], token, sizeof(valueParsed[i]));
-    token = strtok(NULL, delim);
-    i++;
+  ARGparser args;
+  argBegin(&args, buf);
+  control.EOSC  = argNext(&args, 0, 1);
+  control.BBSQW = argNext(&args, 0, 1);
+  control.CONV  = argNext(&args, 0, 1);
+  control.RS    = argNext(&args, 0, 3);
+  control.INTCN = argNext(&args, 0, 1);
+  control.A2IE  = argNext(&args, 0, 1);
+  control.A1IE  = argNext(&args, 0, 1);
+  if (!argEnd(&args)) {
+    argReport(&args);
+    return false;
   }
- 
-  control.EOSC  = atoi(valueParsed[0]);
-  control.BBSQW = atoi(valueParsed[1]);
-  control.CONV  = atoi(valueParsed[2]);
-  control.RS    = atoi(valueParsed[3]);
-  control.INTCN = atoi(valueParsed[4]);
-  control.A2IE  = atoi(valueParsed[5]);
-  control.A1IE  = atoi(valueParsed[6]);
 
+  maskRTCSQW(&control);
   writeReg(&control, CONTROL_REG);
+  return true;
 }
 
 //////////////////////////////////////
@@ -423,6 +445,7 @@ boolean checkStatus(STATUS_FLAGS statusFlag) {
 
 float getRTCTemp() {
   TEMPstruct temp;
+  readReg(&temp, TEMP_REG, sizeof(temp));   // MSB + LSB in one burst
   
   /*TEMP_MSBstruct MSBbits;
   TEMP_LSBstruct LSBbits;
@@ -435,10 +458,10 @@ float getRTCTemp() {
   */
   
   /*
-  Serial.print("MSB = "); Serial.println(MSBbits.data, BIN);
-  Serial.print("LSB = "); Serial.println(LSBbits.dot25, BIN);
+  Serial.print(F("MSB = ")); Serial.println(MSBbits.data, BIN);
+  Serial.print(F("LSB = ")); Serial.println(LSBbits.dot25, BIN);
   Serial.print(temp.MSB_bits.data + temp.LSB_bits.dot25 * 0.25);
-  Serial.println("°C");
+  Serial.println(F("°C"));
   */
   
   //if ( temp.MSB_bits.data + (temp.LSB_bits.dot25 * 0.25) < 30) {
@@ -555,15 +578,15 @@ time_t setRTCDateTime(time_t t = now()) {
 char *getRTCDateTimeStr () {
   //Serial.println("--> RTCDateTimeStr display");
   
-  time_t t = getRTCDateTime();
+  time_t t = getRTCDateTime();   // RTC runs in UTC
   setTime(t);
   tmElements_t tm;
   
-  breakTime(t, tm);
+  breakTime(tzLocal(t), tm);
 
-  static char str[] = "HH:MM:SS dd/mm/yyy day:day";
-  sprintf(str,"%02d:%02d:%02d %02d/%02d/%02d day:%d", 
-          tm.Hour, tm.Minute, tm.Second, tm.Day, tm.Month, tm.Year + 1970, tm.Wday);
+  static char str[] = "HH:MM:SS dd/mm/yyyy day:d TZNAME";
+  snprintf(str, sizeof(str), "%02d:%02d:%02d %02d/%02d/%02d day:%d %s", 
+          tm.Hour, tm.Minute, tm.Second, tm.Day, tm.Month, tm.Year + 1970, tm.Wday, tzName(t));
      
   return str;
 }
@@ -574,30 +597,11 @@ char *getRTCDateTimeStr () {
 // setRTCDateTimeStr set
 //////////////////////////////////////
 
-time_t setRTCDateTimeStr (char *timeStr) {
+time_t setRTCDateTimeStr (const char *timeStr) {
   //Serial.println("--> RTCDateTimeStr set : "); Serial.println(timeStr);
   
-  DATEstruct date;
   tmElements_t tm;
-
-  readReg(&date, DATE_REG, sizeof(date));
-
-  char delim[] = ": /";
-  char values[7][10];
-  char* token = strtok(timeStr, delim);
-  int i = 0;
-  while (token != NULL) {
-    strncpy(values[i], token, sizeof(values[i]));
-    token = strtok(NULL, delim);
-    i++;
-  }
-
-  tm.Hour   = atoi(values[0]);
-  tm.Minute = atoi(values[1]);
-  tm.Second = atoi(values[2]);
-  tm.Day    = atoi(values[3]);
-  tm.Month  = atoi(values[4]);
-  tm.Year   = atoi(values[5]) + 30;
+  if (!strToTm(timeStr, tm)) return 0;   // RTC left untouched
 
   return setRTCDateTime(makeTime(tm));
   
@@ -672,7 +676,9 @@ void setRTCRS(uint8_t val) {
   //Serial.println("--> RTCRS : set " + String(val));
   CONTROLstruct control;
   readReg(&control, CONTROL_REG, sizeof(control));
+  unmaskRTCSQW(&control);
   control.RS  = val;
+  maskRTCSQW(&control);
   writeReg(&control, CONTROL_REG, sizeof(control));
 }
 
@@ -684,7 +690,34 @@ void setRTCINTCN(uint8_t val) {
   //Serial.println("--> RTCINTCN : set " + String(val));
   CONTROLstruct control;
   readReg(&control, CONTROL_REG, sizeof(control));
+  unmaskRTCSQW(&control);
   control.INTCN  = val;
+  maskRTCSQW(&control);
+  writeReg(&control, CONTROL_REG, sizeof(control));
+}
+
+//////////////////////////////////////
+// RTCSQW : 1Hz square wave on INT/SQW, shared by its users
+// RS and INTCN are saved by the first user and restored by the last one
+//////////////////////////////////////
+
+// image : set the bits in a control image about to be written instead of the RTC
+void acquireRTCSQW(CONTROLstruct* image = NULL) {
+  if (sqwUsers++ > 0) return;
+  CONTROLstruct control;
+  if (image == NULL) readReg(&control, CONTROL_REG, sizeof(control));
+  else control = *image;
+  maskRTCSQW(&control);
+  if (image == NULL) writeReg(&control, CONTROL_REG, sizeof(control));
+  else *image = control;
+}
+
+void releaseRTCSQW() {
+  if (sqwUsers == 0 || --sqwUsers > 0) return;
+  CONTROLstruct control;
+  readReg(&control, CONTROL_REG, sizeof(control));
+  control.RS    = sqwSavedRS;
+  control.INTCN = sqwSavedINTCN;
   writeReg(&control, CONTROL_REG, sizeof(control));
 }
 
@@ -795,28 +828,24 @@ time_t setRTCAlarm1Day(time_t t = now()) {
 // RTCAlarm1 Mask set
 //////////////////////////////////////
 
-void setRTCAlarm1MaskStr (char* dateString) {   // "dydt hh mm ss"
+boolean setRTCAlarm1MaskStr (const char* dateString) {   // "dydt hh mm ss"
   //Serial.println("--> RTCAlarm1Mask set : " + String(dateString));
   ALARM1struct alarm;
   readReg(&alarm, ALARM1_REG, sizeof(alarm));
   
-  char delim[] = ": /";
-  char valueParsed[4][10];
-  char* token = strtok(dateString, delim);
-  int i = 0;
-  while (token != NULL) {
-    strncpy(valueParsed[i], token, sizeof(valueParsed[i]));
-    token = strtok(NULL, delim);
-    i++;
+  ARGparser args;
+  argBegin(&args, dateString);
+  alarm.DAY_DATE_bits.m4   = argNext(&args, 0, 1);
+  alarm.HOURS_bits.m3      = argNext(&args, 0, 1);
+  alarm.MINUTES_bits.m2    = argNext(&args, 0, 1);
+  alarm.SECONDS_bits.m1    = argNext(&args, 0, 1);
+  if (!argEnd(&args)) {
+    argReport(&args);
+    return false;
   }
-
-  alarm.DAY_DATE_bits.m4   = atoi(valueParsed[0]);
-  alarm.HOURS_bits.m3      = atoi(valueParsed[1]);
-  alarm.MINUTES_bits.m2    = atoi(valueParsed[2]);
-  alarm.SECONDS_bits.m1    = atoi(valueParsed[3]);
   
   writeReg(&alarm, ALARM1_REG, sizeof(alarm));
-
+  return true;
 }
 
 //////////////////////////////////////
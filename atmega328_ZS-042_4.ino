@@ -1,19 +1,41 @@
 
 #include "avr/sleep.h"
 #include "avr/wdt.h"
-#include "Deep_Sleep.h"
 
 
 #define INTERRUPT_PIN 2
 #define TIME_PIN 3
-boolean digital_interrupt_enabled = true;
-boolean time_interrupt_enabled = true;
 #define POWER_PIN 8
+#define POWER_PIN_SETTLE_MS 2
+
+#define TXQ_EVENT_SIZE 64          // one full notification pair (53 bytes for taskSample)
+#define TXQ_REPORT_SIZE 160
+#define SCHED_SERIAL_IDLE_MS 30000UL
+
+#include "Power_Manager.h"
+#include "Scheduler.h"
+#include "Deep_Sleep.h"
+
+#define TZ_STD_OFFSET 60
+#define TZ_DST_OFFSET 120
+#define TZ_STD_NAME "CET"
+#define TZ_DST_NAME "CEST"
 
 #include "Wire.h"
 #include "time.h"
 #include "ZS042DEFS.h"
 
+#define TEMP_RING_SIZE 16
+#define TEMP_PERIOD_MS 0          // off until "temp N" : an armed timer keeps the CPU out of PWR_DOWN
+#include "Temp_Pipeline.h"
+
+#define CAP_RING_SIZE 32
+#define CAP_SECONDS 8
+#define CAP_BATCH 4
+#include "Pulse_Capture.h"
+#include "Config_Store.h"
+#include "Reg_Watch.h"
+
 #define DS3231_I2C_ADDRESS     0x68
 #define AT24C32_I2C_ADDRESS    0x57  // On-board 32k byte EEPROM; 128 pages of 32 bytes each
 
@@ -22,286 +44,398 @@ boolean time_interrupt_enabled = true;
 //////////////////////////////////////
 
 void digitalInterrupt(){
-  if (digital_interrupt_enabled) {
-    Serial.println("Digital Interrupt !");
-    digital_interrupt_enabled = false;
-  } else {
-    return;
-  }
+  if (capMode != CAP_OFF) capEdge();
+  else schedSignal(EV_DIGITAL);
 }
 
 void timeInterrupt(){
-  if (time_interrupt_enabled) {
-    Serial.println("Time Interrupt !");
-    time_interrupt_enabled = false;
-  } else {
-    return;
-  }
+  // INTCN=0 : TIME_PIN is the 1Hz SQW, otherwise the alarm interrupt
+  if (capMode != CAP_OFF) capAnchor();
+  if (watchMode == WATCH_SQW) schedSignal(EV_WATCH);
+  if (capMode == CAP_OFF && watchMode != WATCH_SQW) schedSignal(EV_ALARM);
 }
 
 //////////////////////////////////////
-// SETUP 
+// COMMANDS
 //////////////////////////////////////
 
-void setup() {
-  Serial.begin(115200);
-  delay(10);
-  Serial.println("Setup Started");
-
-  Wire.begin();
-
-  pinMode(INTERRUPT_PIN, INPUT);
-  pinMode(POWER_PIN,OUTPUT);
-
-  Serial.println(String("attachInterrupt ") + INTERRUPT_PIN);
-  attachInterrupt(digitalPinToInterrupt(INTERRUPT_PIN), digitalInterrupt, FALLING);
-
-  Serial.println(String("attachInterrupt ") + TIME_PIN);
-  attachInterrupt(digitalPinToInterrupt(TIME_PIN), timeInterrupt, FALLING);
-
-  digitalWrite(POWER_PIN,HIGH);
+// tasks[] is indexed by these, keep the table below in the same order
+enum TASK_IDS {
+  TASK_ALARM,
+  TASK_SAMPLE,
+  TASK_SERIAL,
+  TASK_TEMP,
+  TASK_CAPTURE,
+  TASK_WATCH,
+  TASK_COUNT
+};
+extern TASKstruct tasks[];
+
+void getOptions(OPTIONSstruct* options) {
+  options->tempPeriod = tasks[TASK_TEMP].period;
+  options->capMode    = capMode;
+}
 
-  /* init RTC dateTime with PC system time 
-  char dateStr[32] = __TIME__;
-  strcat(dateStr, " 06/01/20 6");
-  Serial.println(dateStr);
-  setRTCDateTimeStr(dateStr);
-  */
-  
-  adjustTime(getRTCDateTime());
-  
-  Serial.println("Setup ended");
+void setOptions(const OPTIONSstruct* options) {
+  schedEvery(&tasks[TASK_TEMP], options->tempPeriod);
+  if (options->capMode != CAP_OFF) capStart((CAP_MODES)options->capMode);
+  else capStop();
 }
 
-//////////////////////////////////////
-// LOOP
-//////////////////////////////////////
+void processCommand(char* rawData) {
+  txPrintf_P(TXQ_REPORT, PSTR("> %s"), rawData);
 
-void loop() {
+  // every command below talks to the RTC
+  powerResume(NEED_RTC);
 
+  char command[] = "command for RTC";
   
-  if(!digital_interrupt_enabled) {
-    digitalWrite(POWER_PIN,HIGH);
-    Serial.println(getRTCDateTimeStr());
-    getRTCStatus();
-    digital_interrupt_enabled = true;
+  strncpy_P(command, PSTR("sleep"), sizeof(command));
+  if (strstr(rawData, command)) {
+    txPrintln_P(TXQ_REPORT, PSTR("Sleep mode"));
+    txPrintln(TXQ_REPORT, getRTCDateTimeStr());
+    txFlush();
+    goToSleep();
   }
 
-  if(!time_interrupt_enabled) {
-    digitalWrite(POWER_PIN,HIGH);
-    Serial.println(getRTCDateTimeStr());
-    setRTCAF(1);
-    time_interrupt_enabled = true;
-  }
-  
-  char rawData[65];
-  if (Serial.available()) {
-    size_t byteCount = Serial.readBytesUntil('\n', rawData, sizeof(rawData) - 1); //read in data to buffer
-    rawData[byteCount] = NULL;//put an end character on the data
-    Serial.print("> ");
-    Serial.println(rawData);
-
-    char command[] = "command for RTC";
-    
-    strncpy(command, "sleep", sizeof(command));
-    if (strstr(rawData, command)) {
-      Serial.println("Sleep mode");
-      Serial.println(getRTCDateTimeStr());
-      Serial.flush();
-      digitalWrite(POWER_PIN,LOW);
-      digital_interrupt_enabled = true;
-      time_interrupt_enabled = true;
-      goToSleep();
-    }
-
-    strncpy(command, "time", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      if(strlen(data) > 2) {
-        Serial.println("data = " + String(data));
-        Serial.println(timeToStr(atol(data)));
-      } else {
-        Serial.print("RTC : "); Serial.println(timeToStr(getRTCDateTime()));
-        Serial.print("now : "); Serial.println(timeToStr(now()));
-      }
+  strncpy_P(command, PSTR("time"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    if(strlen(data) > 2) {
+      txPrintf_P(TXQ_REPORT, PSTR("data = %s"), data);
+      txPrintln(TXQ_REPORT, timeToStr(atol(data)));
+      txPrintln(TXQ_REPORT, timeToLocalStr(atol(data)));
+    } else {
+      time_t t = getRTCDateTime();
+      txPrintf_P(TXQ_REPORT, PSTR("RTC : %s"), timeToStr(t));
+      txPrintf_P(TXQ_REPORT, PSTR("loc : %s"), timeToLocalStr(t));
+      txPrintf_P(TXQ_REPORT, PSTR("now : %s"), timeToStr(now()));
     }
+  }
 
-    strncpy(command, "set", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      if(strlen(data) > 2) {
-        Serial.println("data = " + String(data));
-        Serial.println(setRTCDateTimeStr(data));
-      } else {
-        Serial.println(getRTCDateTimeStr());
-      }
+  strncpy_P(command, PSTR("set"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    if(strlen(data) > 2) {
+      txPrintf_P(TXQ_REPORT, PSTR("data = %s"), data);
+      time_t t = setRTCDateTimeStr(data);      // 0 : parse error, already reported
+      if (t) txPrintf_P(TXQ_REPORT, PSTR("%lu"), (unsigned long)t);
+    } else {
+      txPrintln(TXQ_REPORT, getRTCDateTimeStr());
     }
+  }
 
-    strncpy(command, "unix", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      if(strlen(data) > 2) {
-        Serial.print("data = "); Serial.println(atol(data));
-        setRTCDateTime(atol(data));
-      } 
-      Serial.println(getRTCDateTime());
-    }
+  strncpy_P(command, PSTR("unix"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    if(strlen(data) > 2) {
+      txPrintf_P(TXQ_REPORT, PSTR("data = %ld"), atol(data));
+      setRTCDateTime(atol(data));
+    } 
+    txPrintf_P(TXQ_REPORT, PSTR("%lu"), (unsigned long)getRTCDateTime());
+  }
 
-    strncpy(command, "alarm1", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      if(strlen(data) > 2) {
-        Serial.println("data = " + String(data));
-        setRTCAlarm1Day(atol(data));
-      }
-      Serial.print("time   = "); Serial.println(timeToStr(getRTCDateTime()));
-      Serial.print("alarm1 = "); Serial.println(timeToStr(getRTCAlarm1()));
+  strncpy_P(command, PSTR("alarm1"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    if(strlen(data) > 2) {
+      txPrintf_P(TXQ_REPORT, PSTR("data = %s"), data);
+      setRTCAlarm1Day(atol(data));
     }
+    txPrintf_P(TXQ_REPORT, PSTR("time   = %s"), timeToStr(getRTCDateTime()));
+    txPrintf_P(TXQ_REPORT, PSTR("alarm1 = %s"), timeToStr(getRTCAlarm1()));
+  }
 
-    strncpy(command, "a1mask", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      if(strlen(data) > 3) {
-        Serial.println("data = " + String(data));
-        setRTCAlarm1MaskStr(data);
-      }
-      Serial.println("Day Hrs Min Sec");
-      Serial.println(getRTCAlarm1MaskStr());
+  strncpy_P(command, PSTR("a1mask"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    if(strlen(data) > 3) {
+      txPrintf_P(TXQ_REPORT, PSTR("data = %s"), data);
+      setRTCAlarm1MaskStr(data);
     }
-    
-    strncpy(command, "temp", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      Serial.print(getRTCTemp());
-      Serial.println("°C");
+    txPrintln_P(TXQ_REPORT, PSTR("Day Hrs Min Sec"));
+    txPrintln(TXQ_REPORT, getRTCAlarm1MaskStr());
+  }
+  
+  strncpy_P(command, PSTR("temp"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argPresent(data) && argValue(data, 0, 65, &value)) {
+      schedEvery(&tasks[TASK_TEMP], value * 1000U);   // seconds, 0 = stop
     }
+    tempReport();
+  }
 
-    strncpy(command, "control", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      if(strlen(data) > 2) {
-        Serial.println("data = " + String(data));
-        setRTCControl(data);
-      } else {
-        getRTCControl();
-      }
-    }
+  strncpy_P(command, PSTR("capture"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    if (strstr(data, "raw")) capStart(CAP_RAW);
+    else if (strstr(data, "on")) capStart(CAP_COUNT);
+    else if (strstr(data, "off")) capStop();
+    txPrintf_P(TXQ_REPORT, PSTR("capture %s"), capMode == CAP_RAW ? "raw" : capMode == CAP_COUNT ? "on" : "off");
+  }
 
-    strncpy(command, "status", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      getRTCStatus();
-    }
-    
-    strncpy(command, "EOSC", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCOESC(atoi(data));
-      getRTCStatus();
-    }
+  strncpy_P(command, PSTR("watch"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (strstr(data, "off")) watchStop(&tasks[TASK_WATCH]);
+    else if (strstr(data, "sqw")) watchStart(&tasks[TASK_WATCH], 0);
+    else if (argPresent(data) && argValue(data, 1, 65, &value)) watchStart(&tasks[TASK_WATCH], value);
+    txPrintf_P(TXQ_REPORT, PSTR("watch %s"), watchMode == WATCH_SQW ? "sqw" : watchMode == WATCH_TIMED ? "on" : "off");
+  }
 
-    strncpy(command, "BBSQW", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCBBSQW(atoi(data));
-      getRTCControl();
-    }
+  strncpy_P(command, PSTR("save"), sizeof(command));
+  if (strstr(rawData, command)) {
+    OPTIONSstruct options;
+    getOptions(&options);
+    txPrintln_P(TXQ_REPORT, configSave(&options) ? PSTR("config saved") : PSTR("error : EEPROM write"));
+  }
 
-    strncpy(command, "CONV", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCCONV(atoi(data));
-      getRTCControl();
+  strncpy_P(command, PSTR("config"), sizeof(command));
+  if (strstr(rawData, command)) {
+    CONFIGstruct config;
+    if (configLoad(&config)) {
+      txPrintf_P(TXQ_REPORT, PSTR("config v%d control %02x status %02x temp %u cap %d"), config.version,
+               *(uint8_t*)&config.rtc.control, *(uint8_t*)&config.rtc.status,
+               config.options.tempPeriod, config.options.capMode);
+    } else {
+      txPrintln_P(TXQ_REPORT, PSTR("config none"));
     }
+  }
 
-    strncpy(command, "RS", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCRS(atoi(data));
+  strncpy_P(command, PSTR("control"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    if(strlen(data) > 2) {
+      txPrintf_P(TXQ_REPORT, PSTR("data = %s"), data);
+      setRTCControl(data);
+    } else {
       getRTCControl();
     }
+  }
 
-    strncpy(command, "INTCN", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCINTCN(atoi(data));
-      getRTCControl();
-    }
+  strncpy_P(command, PSTR("status"), sizeof(command));
+  if (strstr(rawData, command)) {
+    getRTCStatus();
+  }
+  
+  strncpy_P(command, PSTR("EOSC"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 1, &value)) setRTCOESC(value);
+    getRTCStatus();
+  }
 
-    strncpy(command, "A2IE", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCA2IE(atoi(data));
-      getRTCControl();
-    }
+  strncpy_P(command, PSTR("BBSQW"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 1, &value)) setRTCBBSQW(value);
+    getRTCControl();
+  }
 
-    strncpy(command, "A1IE", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCA1IE(atoi(data));
-      getRTCControl();
-    }
+  strncpy_P(command, PSTR("CONV"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 1, &value)) setRTCCONV(value);
+    getRTCControl();
+  }
 
-    strncpy(command, "OSF", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[128];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCOSF();
-      getRTCStatus();
-    }
+  strncpy_P(command, PSTR("RS"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 3, &value)) setRTCRS(value);
+    getRTCControl();
+  }
 
-    strncpy(command, "AF", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[64];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCAF(atoi(data));
-      getRTCStatus();
-    }
+  strncpy_P(command, PSTR("INTCN"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 1, &value)) setRTCINTCN(value);
+    getRTCControl();
+  }
+
+  strncpy_P(command, PSTR("A2IE"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 1, &value)) setRTCA2IE(value);
+    getRTCControl();
+  }
+
+  strncpy_P(command, PSTR("A1IE"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 1, &value)) setRTCA1IE(value);
+    getRTCControl();
+  }
+
+  strncpy_P(command, PSTR("OSF"), sizeof(command));
+  if (strstr(rawData, command)) {
+    setRTCOSF();
+    getRTCStatus();
+  }
+
+  strncpy_P(command, PSTR("AF"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 1, 2, &value)) setRTCAF(value);
+    getRTCStatus();
+  }
+
+  strncpy_P(command, PSTR("E32K"), sizeof(command));
+  if (strstr(rawData, command)) {
+    const char* data = &rawData[strlen(command)];
+    int value;
+    if (argValue(data, 0, 1, &value)) setRTCE32K(value);
+    getRTCStatus();
+  }
 
-    strncpy(command, "E32K", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      char data[64];
-      strncpy(data, &rawData[strlen(command)], sizeof(data));
-      setRTCE32K(atoi(data));
-      getRTCStatus();
+  strncpy_P(command, PSTR("now"), sizeof(command));
+  if (strstr(rawData, command)) {
+    txPrintln_P(TXQ_REPORT, PSTR(__DATE__));
+    txPrintln_P(TXQ_REPORT, PSTR(__TIME__));
+  }
+  
+}
+
+//////////////////////////////////////
+// TASKS
+//////////////////////////////////////
+
+char serialLine[65];
+uint8_t serialLen = 0;
+
+// non-blocking line assembly, true once a full line is in serialLine
+boolean serialReadLine() {
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c == '\n') {
+      serialLine[serialLen] = 0;
+      serialLen = 0;
+      return true;
     }
+    if (serialLen < sizeof(serialLine) - 1) serialLine[serialLen++] = c;
+  }
+  return false;
+}
 
-    strncpy(command, "now", sizeof(command));
-    if (strstr(rawData, command)) {
-      digitalWrite(POWER_PIN,HIGH);
-      Serial.println(__DATE__);
-      Serial.println(__TIME__);
+// serial wake : drop RX until the line has been quiet for SCHED_WAKE_GUARD_MS
+boolean serialLost = false;
+unsigned long serialQuietAt = 0;
+
+boolean serialDiscard() {
+  while (Serial.available()) {
+    if (Serial.read() > ' ') serialLost = true;
+    serialQuietAt = millis();
+  }
+  return millis() - serialQuietAt >= SCHED_WAKE_GUARD_MS;
+}
+
+char taskSerial(TASKstruct* task) {
+  PT_BEGIN(&task->pt);
+  while (true) {
+    PT_YIELD_UNTIL(&task->pt, schedRxWoke || serialReadLine());
+    if (schedRxWoke) {
+      // the start of whatever woke us is gone : partial line included
+      serialLost = serialLen != 0;
+      serialLen = 0;
+      serialQuietAt = millis();
+      PT_WAIT_UNTIL(&task->pt, serialDiscard());
+      schedRxWoke = false;
+      if (serialLost) txPrintln_P(TXQ_EVENT, PSTR("error : line lost on wake"));
+      txPrintln_P(TXQ_EVENT, PSTR("wake"));
+      continue;
     }
-    
+    processCommand(serialLine);
   }
+  PT_END(&task->pt);
+}
+
+char taskAlarm(TASKstruct* task) {
+  PT_BEGIN(&task->pt);
+  powerResume(NEED_RTC);
+  txPrintln_P(TXQ_EVENT, PSTR("Time Interrupt !"));
+  txPrintln(TXQ_EVENT, getRTCDateTimeStr());
+  setRTCAF(1);
+  PT_END(&task->pt);
+}
+
+char taskSample(TASKstruct* task) {
+  PT_BEGIN(&task->pt);
+  powerResume(NEED_RTC);
+  txPrintln_P(TXQ_EVENT, PSTR("Digital Interrupt !"));
+  txPrintln(TXQ_EVENT, getRTCDateTimeStr());
+  getRTCStatus();
+  PT_END(&task->pt);
+}
+
+TASKstruct tasks[] = {
+  TASK(taskAlarm,   EV_ALARM,   0),                // TASK_ALARM
+  TASK(taskSample,  EV_DIGITAL, 0),                // TASK_SAMPLE
+  TASK(taskSerial,  EV_SERIAL,  0),                // TASK_SERIAL
+  TASK(taskTemp,    0,          TEMP_PERIOD_MS),   // TASK_TEMP
+  TASK(taskCapture, EV_CAPTURE, 0),                // TASK_CAPTURE
+  TASK(taskWatch,   EV_WATCH,   0)                 // TASK_WATCH
+};
+static_assert(sizeof(tasks) / sizeof(tasks[0]) == TASK_COUNT, "tasks[] and TASK_IDS out of step");
+
+//////////////////////////////////////
+// SETUP 
+//////////////////////////////////////
+
+void setup() {
+  // ADC, timer1, timer2 stay gated until something needs them
+  powerInit(NEED(PERIPH_USART0) | NEED(PERIPH_TIMER0));
+  Serial.begin(115200);
+  Serial.println(F("Setup Started"));
+
+  powerResume(NEED_RTC);        // supply, then Wire.begin()
+
+  // stored configuration, applied without a host
+  OPTIONSstruct options;
+  CONFIG_RESULTS config = configRestore(&options);
+  if (config != CONFIG_NONE) {
+    setOptions(&options);
+    if (options.capMode != CAP_OFF) releaseRTCSQW();   // capStart holds it now, no I2C
+  }
+
+  pinMode(INTERRUPT_PIN, INPUT);
+
+  Serial.print(F("attachInterrupt ")); Serial.println(INTERRUPT_PIN);
+  attachInterrupt(digitalPinToInterrupt(INTERRUPT_PIN), digitalInterrupt, FALLING);
+
+  Serial.print(F("attachInterrupt ")); Serial.println(TIME_PIN);
+  attachInterrupt(digitalPinToInterrupt(TIME_PIN), timeInterrupt, FALLING);
+
+  /* init RTC dateTime with PC system time 
+  char dateStr[32] = __TIME__;
+  strcat(dateStr, " 06/01/20 6");
+  Serial.println(dateStr);
+  setRTCDateTimeStr(dateStr);
+  */
   
+  adjustTime(getRTCDateTime());
+  unsigned long ready = micros();
+  
+  static const char* const configResults[] = { "none", "matched", "applied" };
+  Serial.print(F("config ")); Serial.println(configResults[config]);
+  Serial.print(F("ready in ")); Serial.print(ready); Serial.println(F(" us"));
+  Serial.println(F("Setup ended"));
+}
+
+//////////////////////////////////////
+// LOOP
+//////////////////////////////////////
+
+void loop() {
+  schedRun(tasks, TASK_COUNT);
 }